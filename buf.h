@@ -1,31 +1,66 @@
 #ifndef BUF_H
 #define BUF_H
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 #include "db.h"
+#include "trace.h"
 // define if debug output wanted
 //#define DEBUGBUF
 
 // declarations for buffer pool hash table
 struct hashBucket
 {
-	File*	file;    // pointer a file object (more on this below)
+	File*	file;    // pointer a file object (more on this below), NULL if slot empty
 	int	pageNo;  // page number within a file
 	int	frameNo; // frame number of page in the buffer pool
-	hashBucket* 	next;	 // next node in the hash table
 };
 
 
-// hash table to keep track of pages in the buffer pool
+// number of independently latched partitions of the buffer hash table
+const int HTPARTITIONBITS = 6;
+const int HTPARTITIONS = 1 << HTPARTITIONBITS;
+
+// hash table to keep track of pages in the buffer pool.  Each partition
+// is a flat open-addressing table with linear probing, sized up front
+// so that insert, lookup and remove never allocate; a partition only
+// grows if pages happen to pile up in it.  insert, lookup and remove
+// do not latch anything themselves, the caller must hold the latch
+// returned by partition() for the (file,pageNo) it passes in.
 class BufHashTbl
 {
 private:
-    int HTSIZE;
-    hashBucket**  ht; // actual hash table
-    int	 hash(const File* file, const int pageNo); // returns value between 0 and HTSIZE-1
+    struct Partition
+    {
+        std::mutex   latch;
+        hashBucket*  slots;  // capacity is a power of two
+        unsigned int mask;   // capacity - 1
+        int          count;  // slots in use
+    };
+
+    Partition*  parts;
+    unsigned long long hash(const File* file, const int pageNo); // mixes both into 64 bits
+    Partition & partitionOf(const unsigned long long h)
+    {
+        // top bits pick the partition, low bits the slot within it
+        return parts[h >> (64 - HTPARTITIONBITS)];
+    }
+    void grow(Partition & part);
 
 public:
     BufHashTbl(const int htSize);  // constructor
     ~BufHashTbl(); // destructor
+
+    // latch covering the partition that (file,pageNo) hashes to
+  std::mutex & partition(const File* file, const int pageNo)
+  {
+    return partitionOf(hash(file, pageNo)).latch;
+  }
 	
     // insert entry into hash table mapping (file,pageNo) to frameNo;
     // returns 0 if OK, HASHTBLERROR if an error occurred
@@ -44,19 +79,58 @@ public:
 
 class BufMgr;  //forward declaration of BufMgr class 
 
-// class for maintaining information about buffer pool frames
+// short-term spin latch on a buffer frame.  It is held while the
+// frame changes identity (eviction, flush, dispose) and while its
+// contents are being written back, never across a call that returns
+// to the user.
+class FrameLatch {
+private:
+  std::atomic<bool> held;
+
+public:
+  FrameLatch() : held(false) {}
+
+  bool try_lock()
+  {
+    return !held.load(std::memory_order_relaxed) &&
+           !held.exchange(true, std::memory_order_acquire);
+  }
+  void lock()
+  {
+    while (!try_lock())
+      std::this_thread::yield();
+  }
+  void unlock()
+  {
+    held.store(false, std::memory_order_release);
+  }
+  bool isHeld() const { return held.load(std::memory_order_relaxed); }
+};
+
+// class for maintaining information about buffer pool frames.
+// Latching protocol: pinCnt is only raised while holding the hash
+// partition latch of the page or the frame's own FrameLatch, and a
+// frame is only taken away from its page while holding both, so an
+// unpinned frame seen under both latches stays unpinned.  Taking a
+// page away bumps the frame's generation.
+// Frames are linked into (and out of) their file's list of resident
+// frames under the file's residentLatch, taken last.
 class BufDesc {
     friend class BufMgr;
 private:
   File* file;   // pointer to file object
   int   pageNo; // page within file
   int	frameNo;  // frame # of frame
-  int   pinCnt; // number of times this page has been pinned
-  bool 	dirty;	  // true if dirty;  false otherwise
+  std::atomic<int>  pinCnt; // number of times this page has been pinned
+  std::atomic<bool> dirty;	  // true if dirty;  false otherwise
   bool 	valid;   // true if page is valid
-  bool  refbit;	 // has this buffer frame been reference recently
+  FrameLatch latch; // guards identity changes and write back
+  int   fileNext; // next and previous frame holding a page of the same
+  int   filePrev; // file; the list is headed in File, -1 ends it
+  std::atomic<unsigned int> generation; // pages this frame has lost
 
   void Clear() {  // initialize buffer frame for a new user
+	generation++;
     	pinCnt = 0;
 	file = NULL;
 	pageNo = -1;
@@ -70,64 +144,377 @@ private:
       pinCnt = 1;
       dirty = false;
       valid = true;
-      refbit = true;
   }
 
   BufDesc() {
+      generation = 0;
       Clear();
+      fileNext = filePrev = -1;
+  }
+
+public:
+  bool pinned() const { return pinCnt != 0; }  // for replacement policies
+  bool latched() const { return latch.isHeld(); }
+};
+
+
+// replacement policies a BufMgr can be created with
+enum ReplPolicy { CLOCKPOLICY, TWOQPOLICY };
+
+// Interface between BufMgr::allocBuf and a replacement policy.  The
+// buffer manager reports what happens to each frame, the policy
+// proposes victims.  A proposed frame may turn out to be unusable
+// (pinned or latched by another thread by the time the buffer manager
+// gets to it); victim() is then simply called again, so it must not
+// change its own state until taken() confirms the choice.
+class BufPolicy
+{
+public:
+  virtual ~BufPolicy() {}
+
+  // frame holding a page was hit by readPage
+  virtual void accessed(const int frame) = 0;
+
+  // page (file,pageNo) was read or allocated into frame
+  virtual void loaded(const int frame, const File* file, const int pageNo) = 0;
+
+  // frame proposed by victim() now belongs to a new page; (file,pageNo)
+  // is the page evicted from it, file is NULL if the frame was empty
+  virtual void taken(const int frame, const File* file, const int pageNo) = 0;
+
+  // frame was emptied other than by eviction (dispose, flush, failed read)
+  virtual void freed(const int frame) = 0;
+
+  // frame proposed by victim() was passed over because it is dirty;
+  // it should not be proposed again before the other candidates
+  virtual void skipped(const int frame) = 0;
+
+  // propose an unpinned frame to replace; -1 if all seem to be pinned.
+  // examined is set to the number of frames looked at to find it.  A
+  // frame another thread has latched is proposed again and again until
+  // it is let go, so a policy that keeps its place should prefer others.
+  virtual int victim(const BufDesc* table, int& examined) = 0;
+
+  // fill frames with up to max frames that victim() is likely to
+  // propose soon, soonest first, without changing any state; returns
+  // how many.  The background writer cleans these ahead of time.
+  virtual int upcoming(int* frames, const int max) = 0;
+};
+
+// the classic single reference bit clock.  Lock free: reference bits
+// are atomic and the hand moves with an atomic increment, so several
+// threads can sweep at once.
+class ClockPolicy : public BufPolicy
+{
+private:
+  int numBufs;
+  std::atomic<bool>* refbit;  // has this buffer frame been reference recently
+  std::atomic<unsigned int> clockHand;
+
+  // returns the frame under the clock hand and moves the hand on
+  unsigned int advanceClock()
+  {
+	return clockHand.fetch_add(1) % numBufs;
   }
+
+public:
+  ClockPolicy(const int bufs);
+  ~ClockPolicy();
+
+  void accessed(const int frame) { refbit[frame] = true; }
+  void loaded(const int frame, const File* file, const int pageNo) { refbit[frame] = true; }
+  void taken(const int frame, const File* file, const int pageNo) {}
+  void freed(const int frame) { refbit[frame] = false; }
+  void skipped(const int frame) {}    // the hand has moved past it
+  int  victim(const BufDesc* table, int& examined);
+  int  upcoming(int* frames, const int max);
+};
+
+// Simplified 2Q (Johnson and Shasha, VLDB '94).  Pages enter a FIFO
+// queue (A1in) on first reference and are only promoted to the LRU
+// queue (Am) if they are referenced again after being evicted from
+// A1in, which is remembered in a queue of page ids (A1out).  A
+// sequential scan therefore only cycles through A1in and cannot push
+// the hot pages out of Am.  All state sits behind one mutex; hits on
+// pages in A1in change nothing and do not take it, but hits in Am
+// serialize on it, so use the clock when those must scale.
+class TwoQPolicy : public BufPolicy
+{
+private:
+  enum Queue { FREEQ, A1INQ, AMQ, NOQ };
+
+  struct GhostKey
+  {
+    const File* file;
+    int pageNo;
+    bool operator == (const GhostKey & other) const
+      { return file == other.file && pageNo == other.pageNo; }
+  };
+  struct GhostHash
+  {
+    size_t operator () (const GhostKey & key) const
+      { return (size_t)key.file * 31 + key.pageNo; }
+  };
+  struct Ghost
+  {
+    GhostKey key;
+    unsigned long seq;
+  };
+
+  int numBufs;
+  int kin;                // target size of A1in
+  int kout;               // number of page ids remembered in A1out
+  std::mutex latch;
+
+  // frames are kept on doubly linked lists threaded through these
+  // arrays; the heads are the most recently inserted/used ends
+  int* prev;
+  int* next;
+  std::atomic<char>* queue;  // which list each frame is on; only
+                             // changed under latch
+  int head[NOQ];
+  int tail[NOQ];
+  int size[NOQ];
+
+  // A1out: FIFO of evicted page ids plus an index into it.  The index
+  // holds the sequence number of the newest entry for a page, so that
+  // stale FIFO entries are recognized when they fall off the end.
+  std::deque<Ghost> a1out;
+  std::unordered_map<GhostKey, unsigned long, GhostHash> ghosts;
+  unsigned long ghostSeq;
+
+  void unlink(const int frame);
+  void pushHead(const Queue q, const int frame);
+  int  oldestUnpinned(const Queue q, const BufDesc* table, int& examined,
+                      const bool latched);
+
+public:
+  TwoQPolicy(const int bufs);
+  ~TwoQPolicy();
+
+  void accessed(const int frame);
+  void loaded(const int frame, const File* file, const int pageNo);
+  void taken(const int frame, const File* file, const int pageNo);
+  void freed(const int frame);
+  void skipped(const int frame);
+  int  victim(const BufDesc* table, int& examined);
+  int  upcoming(int* frames, const int max);
 };
 
 
+// Counters are 64 bits and sharded by thread, see Counter; the same
+// events are also counted per file in File::getStats().
 struct BufStats
 {
-  int accesses;    // Total number of accesses to buffer pool
-  int diskreads;   // Number of pages read from disk (including allocs)
-  int diskwrites;  // Number of pages written back to disk
+  Counter accesses;       // Total number of accesses to buffer pool
+  Counter hits;           // accesses that found the page in the pool
+  Counter misses;         // accesses that had to read the page
+  Counter diskreads;      // Number of pages read from disk (including allocs)
+  Counter diskwrites;     // Number of pages written back to disk
+  Counter evictions;      // pages allocBuf took a frame away from
+  Counter dirtyEvictions; // of those, the ones it wrote back first
+  Counter bufferExceeded; // times allocBuf found every frame pinned
+  Counter sweeps;         // victim searches by allocBuf
+  Counter sweepFrames;    // frames the replacement policy looked at in them
+  Histogram missLatency;  // readPage and readPages misses, until pinned
+                          // or failed; one sample per miss counted
 
   void clear()
     {
-      accesses = diskreads = diskwrites = 0;
-    }
-      
-  BufStats()
-    {
-      clear();
+      accesses.clear();
+      hits.clear();
+      misses.clear();
+      diskreads.clear();
+      diskwrites.clear();
+      evictions.clear();
+      dirtyEvictions.clear();
+      bufferExceeded.clear();
+      sweeps.clear();
+      sweepFrames.clear();
+      missLatency.clear();
     }
 };
 
 
+// A pin on a page, handed out by the PageHandle versions of readPage
+// and allocPage.  The handle remembers the frame and its generation, so
+// unpinning, marking dirty and pinning the page again need no hash
+// lookup.  A pin still held when the handle goes away is released.
+class PageHandle
+{
+  friend class BufMgr;
+private:
+  BufMgr*  mgr;
+  File*    file;
+  int      pageNo;
+  int      frameNo;     // -1 for a page of a mapped file
+  unsigned int generation; // of the frame when the page was pinned
+  Page*    page;
+  bool     pinned;
+  bool     dirty;       // markDirty() since the page was pinned
+
+public:
+  PageHandle();
+  PageHandle(PageHandle && other);
+  PageHandle & operator = (PageHandle && other);
+  ~PageHandle();
+
+  PageHandle(const PageHandle &) = delete;
+  PageHandle & operator = (const PageHandle &) = delete;
+
+  Page* operator -> () const { return page; }
+  Page* get() const { return page; }    // NULL if there never was a page
+  File* getFile() const { return file; }
+  int   getPageNo() const { return pageNo; }
+  bool  isPinned() const { return pinned; }
+
+  void  markDirty() { dirty = true; }   // written back once unpinned
+
+  // drop the pin; PAGENOTPINNED if there is none
+  const Status unpin();
+
+  // pin the same page again; HASHNOTFOUND if it has left the pool in
+  // the meantime, in which case readPage has to bring it back
+  const Status repin();
+};
+
+
+// most pages fetched by one read-ahead or prefetch request, and most
+// pages written by one coalesced write
+const int MAXREADAHEAD = 128;
+
+// dirty victims allocBuf passes over while the background writer runs
+const int MAXDIRTYSKIPS = 16;
+
+// reads of a mapped file in a row that have to go against the current
+// madvise() hint before it is switched between sequential and random
+const int MAPSTREAK = 8;
+
+// Pages of files opened with OPENMMAP never enter the pool: readPage
+// points straight into the file's mapping and pins are only counted
+// per file, so that flushFile and close can tell if any are left.
+//
+// The buffer manager may be shared by any number of threads.  Hits
+// only take the latch of one hash partition and pin counts are atomic;
+// how well victim selection scales depends on the replacement policy.
 class BufMgr 
 {
+  friend class PageHandle;
 private:
-  unsigned int 	 clockHand;
   int   	 numBufs;    	// Number of pages in buffer pool
   BufHashTbl*    hashTable;  	// hash table mapping (File, page) to frame
   BufDesc*	 bufTable;  	// vector of status info, 1 per page
   BufStats	 bufStats;	// buffer pool statistics
+  BufPolicy*	 policy;	// picks frames for allocBuf
+  size_t	 poolBytes;	// size of the bufPool mapping
+  int		 readAhead;	// pages fetched on a sequential miss
 
-  const Status allocBuf(int & frame);   // allocate a free frame.  
-  const void releaseBuf(int frame); // return unused frame to end of list
-  void advanceClock()
+  // background writer, see startWriter()
+  std::thread*	 writer;
+  std::mutex	 writerLatch;
+  std::condition_variable writerWake;
+  bool		 writerStop;
+  int		 writerAhead;	// frames ahead of the victim to keep clean
+  int		 writerInterval; // milliseconds between rounds
+
+  TraceWriter*	 tracer;	// calls are recorded here, see startTrace()
+
+  void traced(const TraceOp op, const File* file, const int pageNo,
+	      const bool dirty = false)
   {
-	clockHand = (clockHand + 1) % numBufs;
+    if (tracer != NULL)
+      tracer->record(op, file, pageNo, dirty);
   }
 
+  const Status allocBuf(int & frame);   // allocate a free frame.  
+  const void releaseBuf(int frame); // return unused frame to end of list
+
+  // writes out frames whose latches the caller holds and whose dirty
+  // bits it has cleared, sorted by (file, pageNo) and coalesced into
+  // one vectored write per run of consecutive pages
+  const Status writeFrames(std::vector<int> & frames);
+  void writerLoop();
+
+  // enters a page just read into claimed frame frameNo in the hash
+  // table; returns the frame holding the page, -1 on a hash table error
+  int installPage(File* file, const int pageNo, const int frameNo,
+		  const bool pin);
+
+  // reads the absent pages among count pages from firstPage with
+  // vectored reads; pins firstPage and returns it if pinFirst is set
+  const Status fetchRun(File* file, const int firstPage, int count,
+			const bool pinFirst, Page*& page);
+
+  // add frameNo to, or take it off, the list of frames of file
+  void linkFrame(File* file, const int frameNo);
+  void unlinkFrame(File* file, const int frameNo);
+
+  // flushFile and invalidateFile: drops every page of file from the
+  // pool, writing dirty ones first if writeDirty is set
+  const Status dropPages(const File* file, const bool writeDirty);
+
+  // fills in handle for the page just pinned at page
+  void attach(PageHandle & handle, File* file, const int pageNo, Page* page);
+  const Status unpinHandle(PageHandle & handle);
+  const Status repinHandle(PageHandle & handle);
+
+  // readPage for a file opened with OPENMMAP
+  const Status readMapped(File* file, const int pageNo, Page*& page);
+
 
 public:
   Page*	         bufPool;   // actual buffer pool
 
-  BufMgr(const int bufs);
+  // bufPool is mapped anonymously, so frames are page aligned.  With
+  // hugePages it is backed by huge pages if the system has them
+  // reserved, else transparent huge pages are asked for.
+  BufMgr(const int bufs, const ReplPolicy replPolicy = CLOCKPOLICY,
+         const bool hugePages = false);
   ~BufMgr();
 
   const Status readPage(File* file, const int PageNo, Page*& page);
   const Status unPinPage(File* file, const int PageNo, const bool dirty);
   const Status allocPage(File* file, int& PageNo, Page*& page); 
                         // allocates a new, empty page 
+
+  // same as above, with the pin held by handle, which gives up any pin
+  // it held before
+  const Status readPage(File* file, const int PageNo, PageHandle & handle);
+  const Status allocPage(File* file, int& PageNo, PageHandle & handle);
   const Status flushFile(const File* file); // writing out all dirty pages of the file
+  const Status invalidateFile(const File* file); // drop the file's pages unwritten
   const Status disposePage(File* file, const int PageNo); // dispose of page in file
+  const Status prefetch(File* file, const int firstPage, const int count);
+                        // read pages into the pool without pinning them
+  void  setReadAhead(const int pages); // 0 turns sequential read-ahead off
+
+  // pin count pages of file at once, like count readPage calls, with
+  // all the misses read concurrently through the asynchronous engine
+  const Status readPages(File* file, const int count, const int* pageNos,
+                         Page** pages);
+
+  // start a thread that keeps cleanFraction of the pool, taken from
+  // the frames the replacement policy will evict next, clean; it runs
+  // every intervalMs and whenever a miss had to write a dirty victim
+  const Status startWriter(const double cleanFraction, const int intervalMs);
+  void  stopWriter();
+
+  // record every readPage, unPinPage, allocPage and disposePage that
+  // succeeds, and the pins of readPages and PageHandles, to a trace in
+  // path (see trace.h) until stopTrace.  Both must be called while no
+  // other thread is using the pool.
+  const Status startTrace(const std::string & path);
+  const Status stopTrace();
+
+  // a summary of the pool and its statistics; the frames themselves
+  // too if DEBUGBUF is defined
   void  printSelf();
 
+  // write a snapshot of the pool and its statistics, and those of
+  // every open file, to out as one JSON object or as Prometheus text.
+  // Nothing is latched: counters are read as they are at the moment.
+  void  exportStats(std::ostream & out, const StatsFormat format);
+
   const BufStats & getBufStats() const // get buffer pool usage
   {
 	return bufStats;
@@ -3,7 +3,12 @@
 
 #include <sys/types.h>
 #include <functional>
+#include <atomic>
+#include <future>
+#include <mutex>
 #include "error.h"
+#include "pageio.h"
+#include "stats.h"
 #include <string.h>
 using namespace std;
 
@@ -15,20 +20,64 @@ using namespace std;
 // forward class definition for db
 class DB;
 
+// structure of DB (header) page
+
+typedef struct {
+  int nextFree;                         // page # of next page on free list
+  int firstPage;                        // page # of first page in file
+  int numPages;                         // total # of pages in file
+  int pageSize;                         // bytes per page; 0 in files made
+                                        // before it was recorded (1024)
+  int fsmPage;                          // first page of the free-space
+                                        // map, 0 if there is none
+} DBPage;
+
+// ways of opening a file.  A mapped file is read-only: it is mmap()ed
+// and BufMgr hands out pages straight from the mapping instead of
+// copying them into the buffer pool.  A direct file is read and
+// written with O_DIRECT, bypassing the OS page cache; that needs a file
+// system that supports it and a PAGESIZE that is a multiple of the
+// device's block size.
+enum OpenMode { OPENBUFFERED, OPENMMAP, OPENDIRECT };
+
 // class definition for open files
 class File {
   friend class DB;
   friend class OpenFileHashTbl;
+  friend class BufMgr;
 
  public:
 
   Status allocatePage(int& pageNo);     // allocate a new page
+  Status allocatePages(const int count,
+                       int& firstPageNo); // allocate count pages in a row
   const Status disposePage(const int pageNo);       // release space for a page
   const Status readPage(const int pageNo,
 		  Page* pagePtr) const;       // read page from file
+  const Status readPages(const int pageNo, const int count,
+                         Page* const* pagePtrs) const; // read a run of pages
   const Status writePage(const int pageNo,
 		   const Page* pagePtr);      // write page to file
+  const Status writePages(const int pageNo, const int count,
+                          const Page* const* pagePtrs); // write a run of pages
+
+  // asynchronous versions: the I/O goes to ioEngine() and done is
+  // called with its outcome; the page must stay put until then
+  const Status readPageAsync(const int pageNo, Page* pagePtr,
+                             IOCallback done) const;
+  const Status writePageAsync(const int pageNo, const Page* pagePtr,
+                              IOCallback done);
+  future<Status> readPageAsync(const int pageNo, Page* pagePtr) const;
+  future<Status> writePageAsync(const int pageNo, const Page* pagePtr);
+
   const Status getFirstPage(int& pageNo) const;     // returns pageNo of first page
+  const Status getNumPages(int& numPages) const;    // pages in file, header included
+  const Status getFsmPage(int& pageNo) const;       // first free-space map page
+  const Status setFsmPage(const int pageNo);
+  const Status sync();                  // write cached header page to disk
+
+  // counters and I/O latencies of this file, see FileStats
+  const FileStats & getStats() const { return stats; }
 
   bool operator == (const File & other) const
     {
@@ -43,13 +92,18 @@ class File {
   static const Status create(const string &fileName);
   static const Status destroy(const string &fileName);
 
-  const Status open();
+  const Status open(const OpenMode mode);
   const Status close();
+  const Status map();                 // set up the mapping of a mapped file
 
   const Status intread(const int pageNo,
 		 Page* pagePtr) const;        // internal file read
   const Status intwrite(const int pageNo,
 		  const Page* pagePtr);       // internal file write
+  const Status intreadv(const int pageNo, const int count,
+                        Page* const* pagePtrs) const; // internal vectored read
+  const Status intwritev(const int pageNo, const int count,
+                         const Page* const* pagePtrs); // internal vectored write
 
 #ifdef DEBUGFREE
   void listFree();                      // list free pages
@@ -58,6 +112,22 @@ class File {
   string fileName;                    // The name of the file
   int openCnt;                        // # times file has been opened
   int unixFile;                       // unix file stream for file
+  OpenMode openMode;                  // how the file was opened
+  DBPage header;                      // cached header page, valid while open
+  bool hdrDirty;                      // header changed since last written
+  mutable mutex hdrLatch;             // serializes header page updates
+  atomic<int> raNext;                 // BufMgr read-ahead: next page of a
+                                      // sequential run of misses
+  mutable mutex residentLatch;        // guards residentHead and the list
+  int residentHead;                   // BufMgr: first frame holding a page
+                                      // of this file, -1 if none
+  char* mapping;                      // whole file if mapped, else NULL
+  size_t mapSize;                     // bytes mapped
+  atomic<int> mapPins;                // pages of the mapping pinned
+  atomic<int> mapStreak;              // >0 sequential reads in a row,
+                                      // <0 random ones
+  atomic<bool> mapSequential;         // madvise() hint currently in force
+  mutable FileStats stats;            // bumped by reads, BufMgr and writes
 };
 
 class BufMgr;
@@ -106,20 +176,12 @@ class DB {
   const Status createFile(const string & fileName) ;  // create a new file
   const Status destroyFile(const string & fileName) ; // destroy a file, 
                                                            // release all space
-  const Status openFile(const string & fileName, File* & file);  // open a file
+  const Status openFile(const string & fileName, File* & file,
+                        const OpenMode mode = OPENBUFFERED);  // open a file
   const Status closeFile(File* file);         // close a file
 
  private:
   OpenFileHashTbl   openFiles;    // list of open files
 };
 
-
-// structure of DB (header) page
-
-typedef struct {
-  int nextFree;                         // page # of next page on free list
-  int firstPage;                        // page # of first page in file
-  int numPages;                         // total # of pages in file
-} DBPage;
-
 #endif
@@ -0,0 +1,87 @@
+#ifndef FSM_H
+#define FSM_H
+
+#include <mutex>
+#include <vector>
+#include "page.h"
+#include "buf.h"
+
+// Free-space map of a file.  Every data page on the file's page chain
+// gets a four bit free-space class: class c promises at least
+// c * PAGESIZE / FSMCLASSES bytes free.  The classes are kept in map
+// pages of their own, chained from the file header (DBPage.fsmPage),
+// and mirrored in memory, so finding a page with room for a record is
+// a search of a small array instead of a walk down the page chain.
+//
+// Once a file has a map, records must be inserted and deleted, and
+// pages added to the chain, through its FreeSpaceMap, or the map goes
+// stale.  A FreeSpaceMap reads and writes pages through bufMgr.
+
+// number of free-space classes, one nibble per page
+const int FSMCLASSES = 16;
+
+// pages summarized in one map page
+const int FSMPERPAGE = 2 * (PAGESIZE - 2 * sizeof(int));
+
+class FreeSpaceMap
+{
+private:
+  // layout of a map page
+  struct FSMPage
+  {
+    int nextPage;                  // next map page, -1 if last
+    int lastPage;                  // first map page only: last page of
+                                   // the data chain
+    unsigned char classes[FSMPERPAGE / 2];  // two pages per byte, low
+                                   // nibble for the even page
+  };
+  static_assert(sizeof(FSMPage) <= sizeof(Page), "FSMPage larger than Page");
+
+  File* file;
+  PageFormat format;               // of the pages added to the chain
+  vector<int> mapPages;            // map pages, in chain order
+  vector<unsigned char> classes;   // class of every page, by page number
+  vector<unsigned char> blockMax;  // highest class of each run of
+                                   // FSMBLOCK pages
+  int lastPage;                    // last page of the data chain
+  int cursor;                      // where the last search succeeded
+  mutex latch;                     // one insert or delete at a time
+
+  static const int FSMBLOCK = 64;
+
+  static int classOf(const int freeSpace);  // class a page has
+  static int classFor(const int bytes);     // class a page needs
+
+  void grow(const int pages);
+  const Status load(const int firstMapPage);
+  const Status build();
+  const Status addMapPage();
+  const Status setClass(const int pageNo, const int cls);
+  const Status setLastPage(const int pageNo);
+  const Status extend(int& pageNo, Page*& page);
+  int search(const int cls);
+
+public:
+  // Reads the map of file, or builds one by walking its page chain if
+  // it has none yet; a file with no pages gets its first page here.
+  // status is OK or the error that stopped it.
+  FreeSpaceMap(File* file, Status& status,
+               const PageFormat format = COMPACTPAGE);
+
+  // insert rec into some page with room for it, adding a page to the
+  // end of the chain if none has.  NOSPACE if rec does not fit on an
+  // empty page.
+  const Status insertRecord(const Record & rec, RID& rid);
+
+  // delete the record with the specified rid
+  const Status deleteRecord(const RID & rid);
+
+  // number of a page whose class says it has room for bytes more
+  // bytes (record plus slot), or FILEEOF if no page does
+  const Status findPage(const int bytes, int& pageNo);
+
+  // record the free space of a page the caller changed itself
+  const Status update(const int pageNo, const Page* page);
+};
+
+#endif
@@ -17,37 +17,91 @@ struct Record
   int length;
 };
 
+// comparisons a record filter can make
+enum Operator { LT, LTE, EQ, GTE, GT, NE };
+
+// selects the records holding an int at offset that is op value;
+// records too short to hold it are never selected
+struct RecordFilter
+{
+  int offset;
+  Operator op;
+  int value;
+};
+
 // slot structure
 struct slot_t {
         short	offset;  
         short	length;  // equals -1 if slot is not in use
 };
 
-const unsigned PAGESIZE = 1024;
+// Page size in bytes, fixed at compile time: build with
+// "make PAGESIZE=4096" (or 8192, 16384).  Files record the page size
+// they were created with and cannot be opened by a build using another.
+#ifndef DB_PAGESIZE
+#define DB_PAGESIZE 1024
+#endif
+const unsigned PAGESIZE = DB_PAGESIZE;
+static_assert(PAGESIZE >= 1024 && PAGESIZE <= 16384 &&
+              (PAGESIZE & (PAGESIZE - 1)) == 0,
+              "PAGESIZE must be a power of two from 1024 to 16384");
+
+// alignment of every Page in memory, enough for O_DIRECT transfers
+const unsigned PAGEALIGN = PAGESIZE < 4096 ? PAGESIZE : 4096;
 const unsigned DPFIXED= sizeof(slot_t)+4*sizeof(short)+2*sizeof(int);
 const unsigned PAGEDATASIZE = PAGESIZE-DPFIXED+sizeof(slot_t);
 // size of the data area of a page
+const unsigned PAGEMAXSLOTS = PAGEDATASIZE / sizeof(slot_t);
+// most slots a page can have
+
+// Record layouts a page can be initialized with.  COMPACTPAGE pages
+// close the hole left by a deleted record right away.  LAZYPAGE pages
+// leave holes until an insert does not fit in the contiguous free
+// space, and chain free slots into a list so that one is found
+// without a search.
+enum PageFormat { COMPACTPAGE, LAZYPAGE };
 
 // Class definition for a minirel data page.   
 // The design assumes that records are kept compacted when
-// deletions are performed. Notice, however, that the slot
+// deletions are performed, unless the page was initialized as a
+// LAZYPAGE. Notice, however, that the slot
 // array cannot be compacted.  Notice, this class does not keep
 // the records align, relying instead on upper levels to take
 // care of non-aligned attributes
 
-class Page {
+class alignas(PAGEALIGN) Page {
 private:
     char 	data[PAGESIZE - DPFIXED]; 
     slot_t 	slot[1]; // first element of slot array - grows backwards!
     short	slotCnt; // number of slots in use;
     short	freePtr; // offset of first free byte in data[]
     short	freeSpace; // number of bytes free in data[]
-    short	dummy;	// for alignment purposes
+    short	dummy;	// LAZYPAGE: LAZYFLAG plus 1 + the first free slot
+			// (0 if none); 0 on COMPACTPAGE pages
     int		nextPage; // forwards pointer
     int		curPage;  // page number of current pointer
 
+    // slot i, i <= 0.  The slot array grows backwards from slot[0] into
+    // the end of data[], so it must not be indexed as slot[i]: the
+    // optimizer is free to assume an index into slot[1] is always 0.
+    slot_t & slotAt(const int i)
+      { return ((slot_t*)(data + sizeof data))[i]; }
+    const slot_t & slotAt(const int i) const
+      { return ((const slot_t*)(data + sizeof data))[i]; }
+
+    // LAZYPAGE bookkeeping.  A free slot has length -1 and keeps the
+    // (positive) number of the next free slot, or -1, in its offset.
+    bool lazy() const;
+    int  freeSlotHead() const;           // -1 if no slot is free
+    void setFreeSlotHead(const int slotNo);
+    int  contiguousFree() const;         // bytes between records and slots
+    void compact();                      // close all holes
+    const Status lazyInsert(const Record & rec, RID& rid);
+    const Status lazyDelete(const int slotNo);
+
 public:
-    void init(const int pageNo); // initialize a new page
+    void init(const int pageNo,
+              const PageFormat format = COMPACTPAGE); // initialize a new page
     void dumpPage() const;       // dump contents of a page
 
     const Status getNextPage(int& pageNo) const; // returns value of nextPage
@@ -70,6 +124,13 @@ public:
 
     // returns reference to record with RID rid
     const Status getRecord(const RID & rid, Record & rec);
+
+    // fills rids and recs with every record on the page that filter
+    // selects, or every record if there is no filter, in slot order,
+    // and returns how many there are.  Both need room for
+    // PAGEMAXSLOTS entries.
+    const int getRecords(RID* rids, Record* recs,
+                         const RecordFilter* filter = NULL);
 };
 
 #endif
@@ -0,0 +1,143 @@
+#ifndef PAGEIO_H
+#define PAGEIO_H
+
+#include <sys/types.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "error.h"
+using namespace std;
+
+// Asynchronous page I/O.  An IOEngine accepts positioned reads and
+// writes on a unix file descriptor and reports each completion by
+// calling the request's callback, from a thread owned by the engine.
+// Callbacks must be short and must not submit further I/O: they hold
+// up every other completion, and submit() may wait for one of those.
+
+// called once per request with OK, or UNIXERR if the transfer failed
+// or was short
+typedef function<void(Status)> IOCallback;
+
+enum IOEngineKind { URINGIO, THREADIO };
+
+// requests the default engine keeps in flight
+const int IODEPTH = 64;
+
+class IOEngine
+{
+public:
+  virtual ~IOEngine() {}
+
+  // queue a transfer of nbytes between buf and fd at offset.  Blocks
+  // while the engine already has its queue depth of requests in flight.
+  virtual const Status submit(const bool write, const int fd, void* buf,
+                              const size_t nbytes, const off_t offset,
+                              IOCallback done) = 0;
+
+  virtual const char* name() const = 0;
+
+  // an io_uring engine if kind is URINGIO and the kernel lets us set
+  // one up, a pread/pwrite thread pool otherwise
+  static IOEngine* create(const IOEngineKind kind, const int queueDepth);
+};
+
+// engine used by File's asynchronous calls, created on first use with
+// URINGIO; replace it with setIOEngine() before any I/O is submitted
+IOEngine* ioEngine();
+void setIOEngine(IOEngine* engine);
+
+
+// io_uring through the raw system calls.  Submissions are serialized
+// on one latch; a single thread reaps completions and runs callbacks.
+class UringEngine : public IOEngine
+{
+private:
+  struct Request
+  {
+    size_t nbytes;
+    IOCallback done;
+  };
+
+  int ringFd;
+  unsigned int depth;
+  void* sqRing;
+  void* cqRing;
+  size_t sqRingSize;
+  size_t cqRingSize;
+  struct io_uring_sqe* sqes;
+
+  // ring fields, pointers into the shared mappings
+  atomic<unsigned int>* sqHead;
+  atomic<unsigned int>* sqTail;
+  unsigned int sqMask;
+  unsigned int* sqArray;
+  atomic<unsigned int>* cqHead;
+  atomic<unsigned int>* cqTail;
+  unsigned int cqMask;
+  struct io_uring_cqe* cqes;
+
+  mutex latch;                 // guards the submission queue and inFlight
+  condition_variable room;     // signalled when a request completes
+  unsigned int inFlight;
+  bool stopping;
+  thread* reaper;
+
+  const Status push(const unsigned char opcode, const int fd, void* buf,
+                    const size_t nbytes, const off_t offset, Request* req);
+  void reap();
+
+public:
+  UringEngine();
+  ~UringEngine();
+
+  // sets up the ring; UNIXERR if the kernel does not support io_uring
+  const Status init(const int queueDepth);
+
+  const Status submit(const bool write, const int fd, void* buf,
+                      const size_t nbytes, const off_t offset,
+                      IOCallback done);
+  const char* name() const { return "io_uring"; }
+};
+
+
+// fallback: a pool of threads doing blocking pread/pwrite, one per
+// request up to the queue depth
+class ThreadIOEngine : public IOEngine
+{
+private:
+  struct Request
+  {
+    bool write;
+    int fd;
+    void* buf;
+    size_t nbytes;
+    off_t offset;
+    IOCallback done;
+  };
+
+  mutex latch;
+  condition_variable work;     // signalled when a request is queued
+  condition_variable room;     // signalled when a request completes
+  deque<Request> queue;
+  unsigned int depth;
+  unsigned int inFlight;       // queued or being worked on
+  bool stopping;
+  vector<thread> workers;
+
+  void serve();
+
+public:
+  ThreadIOEngine(const int queueDepth);
+  ~ThreadIOEngine();
+
+  const Status submit(const bool write, const int fd, void* buf,
+                      const size_t nbytes, const off_t offset,
+                      IOCallback done);
+  const char* name() const { return "threads"; }
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <vector>
+#include "page.h"
+#include "buf.h"
+
+// Scan of the records of a file, a page at a time.  The scan follows
+// the page chain from the file's first page, keeps the page it is on
+// pinned, and hands back the RIDs and records of all live slots on it
+// in two arrays.  A filter on an int at a fixed offset in the record
+// is applied while the slot array is read, see Page::getRecords.
+
+class BatchScan
+{
+private:
+  File* file;
+  int curPageNo;           // page pinned, -1 if none
+  Page* curPage;
+  int nextPageNo;          // page to go to next, -1 at the end of file
+  bool filtered;
+  RecordFilter filter;
+  vector<RID> rids;        // of the current batch
+  vector<Record> recs;
+
+  const Status release();  // unpin the current page
+
+public:
+  // status is OK, or the error getting the first page of file
+  BatchScan(File* file, Status& status);
+  ~BatchScan();
+
+  // only return records whose int at offset is op value; BADSCANPARM
+  // if offset is negative
+  const Status setFilter(const int offset, const Operator op,
+                         const int value);
+
+  // move to the next page holding a record that passes the filter.
+  // count is the number of records in the batch, which stay valid
+  // until the next call.  FILEEOF after the last page.
+  const Status nextBatch(int& count);
+
+  const RID* getRids() const { return &rids[0]; }
+  const Record* getRecords() const { return &recs[0]; }
+
+  // unpin the current page and end the scan
+  const Status endScan();
+};
+
+#endif
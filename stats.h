@@ -0,0 +1,134 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <functional>
+#include <ostream>
+#include <string>
+using namespace std;
+
+// Instrumentation: event counters and latency histograms that any
+// number of threads can bump without taking a latch, and helpers that
+// write them out as JSON or as Prometheus text.
+
+// copies every Counter keeps, so that threads counting the same event
+// mostly touch different cache lines
+const int STATSHARDS = 8;
+
+// 64 bit event counter, split into shards.  A thread always adds to
+// the same shard; reading sums them, so a value read while others
+// count is a little stale but never torn.
+class Counter
+{
+private:
+  struct alignas(64) Shard
+  {
+    atomic<unsigned long long> n;
+  };
+  Shard shards[STATSHARDS];
+
+  static int shard()      // the calling thread's shard
+  {
+    static atomic<int> threads(0);
+    static thread_local int mine = threads++ % STATSHARDS;
+    return mine;
+  }
+
+public:
+  Counter() { clear(); }
+  Counter(const Counter &) = delete;
+  Counter & operator = (const Counter &) = delete;
+
+  void add(const unsigned long long n)
+    { shards[shard()].n.fetch_add(n, memory_order_relaxed); }
+  void operator ++ (int) { add(1); }
+  void operator += (const unsigned long long n) { add(n); }
+
+  unsigned long long value() const;
+  operator unsigned long long () const { return value(); }
+  void clear();
+};
+
+// buckets of a Histogram: bucket b holds samples of less than 2^b
+// nanoseconds that did not fit in bucket b-1; the last one also takes
+// everything longer (2^39 ns is about 9 minutes).  Each is split into
+// HISTSUBBUCKETS of equal width, so that percentiles are good to an
+// eighth of their value rather than a factor of two.
+const int HISTBUCKETS = 40;
+const int HISTSUBBUCKETS = 8;
+
+// log2 histogram of latencies in nanoseconds
+class Histogram
+{
+private:
+  atomic<unsigned long long> buckets[HISTBUCKETS][HISTSUBBUCKETS];
+  atomic<unsigned long long> count;
+  atomic<unsigned long long> sum;      // of all samples, ns
+
+public:
+  Histogram() { clear(); }
+  Histogram(const Histogram &) = delete;
+  Histogram & operator = (const Histogram &) = delete;
+
+  void record(const unsigned long long ns);
+  void recordSince(const unsigned long long startNs)
+    { record(nowNs() - startNs); }
+  void merge(const Histogram & other);   // add the samples of other
+
+  unsigned long long getCount() const { return count; }
+  unsigned long long getSum() const { return sum; }
+  unsigned long long getBucket(const int b) const;
+
+  // upper bound of the sub-bucket holding the p-th fraction of samples
+  // (p in 0..1), 0 if there are none
+  unsigned long long percentile(const double p) const;
+  void clear();
+
+  // monotonic clock in nanoseconds, for timing what gets recorded
+  static unsigned long long nowNs();
+};
+
+// counters and latencies of one open file.  BufMgr counts the pool
+// events, File the I/O it does.
+struct FileStats
+{
+  string name;
+  Counter hits;            // readPage found the page in the pool
+  Counter misses;          // readPage had to read it
+  Counter evictions;       // pages of the file pushed out of the pool
+  Counter dirtyEvictions;  // of those, the ones written back first
+  Counter pagesRead;
+  Counter pagesWritten;
+  Histogram readLatency;   // of each read system call
+  Histogram writeLatency;  // of each write system call
+};
+
+// The stats of every open file are on a list so that they can be
+// exported; File adds and removes its own.  forEachFileStats holds
+// the list's latch while it calls visit, so a file cannot go away
+// under it.
+void addFileStats(FileStats* stats);
+void removeFileStats(FileStats* stats);
+void forEachFileStats(function<void(const FileStats &)> visit);
+
+// formats the exports can be written in
+enum StatsFormat { STATSJSON, STATSPROMETHEUS };
+
+// Writing single values.  JSON values come out as "name":value, with
+// a comma first unless first is set; a histogram as an object with
+// its count, sum and buckets.  Prometheus samples come out as a line
+// of metric name, labels (a string like file="x", or empty) and
+// value; a histogram as its cumulative buckets, sum and count, in
+// seconds.  All samples of one metric must follow its TYPE line.
+string statsQuote(const string & text);   // escaped, in double quotes
+void writeJSON(ostream & out, const char* name,
+               const unsigned long long value, const bool first = false);
+void writeJSON(ostream & out, const char* name, const Histogram & hist,
+               const bool first = false);
+void writePrometheusType(ostream & out, const char* name, const char* type);
+void writePrometheus(ostream & out, const char* name, const string & labels,
+                     const unsigned long long value);
+void writePrometheus(ostream & out, const char* name, const string & labels,
+                     const Histogram & hist);
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "db.h"
+#include "stats.h"
+
+// Page access traces.  While BufMgr::startTrace() is on, every
+// successful readPage, unPinPage, allocPage and disposePage is
+// appended to a trace file, which replayTrace (and bench replay) can
+// play back against a pool of any size with any number of threads.
+//
+// A trace is text, one call per line:
+//
+//   F <file> <name>                   file number <file> is <name>
+//   <thread> R <file> <pageNo>        readPage
+//   <thread> U <file> <pageNo> <0|1>  unPinPage, not dirty or dirty
+//   <thread> A <file> <pageNo>        allocPage, which returned pageNo
+//   <thread> D <file> <pageNo>        disposePage
+//
+// Threads and files are numbered from 0 in the order they first show
+// up; an F line comes before the first call on its file.  Lines
+// starting with # are comments.
+
+enum TraceOp { TRACEREAD = 'R', TRACEUNPIN = 'U', TRACEALLOC = 'A',
+               TRACEDISPOSE = 'D' };
+
+// one call of a trace
+struct TraceEntry
+{
+  int thread;
+  TraceOp op;
+  int file;
+  int pageNo;
+  bool dirty;      // TRACEUNPIN only
+};
+
+// Appends calls to a trace file.  Any number of threads may record at
+// once; lines go out whole, in the order their calls returned.
+class TraceWriter
+{
+private:
+  FILE* out;
+  mutex latch;
+  unordered_map<const File*, int> fileNos;   // by the open File
+  unordered_map<string, int> nameNos;        // and by name, for files
+                                             // closed and opened again
+  vector<string> names;                      // of each file number
+  unordered_map<thread::id, int> threadNos;
+
+  int fileNo(const File* file);              // numbers new files
+
+public:
+  TraceWriter();
+  ~TraceWriter();
+
+  // start a new trace in path; UNIXERR if it cannot be created
+  const Status open(const string & path);
+
+  void record(const TraceOp op, const File* file, const int pageNo,
+              const bool dirty = false);
+
+  // UNIXERR if any of the trace could not be written
+  const Status close();
+};
+
+// Read a whole trace: files gets the name of each file number, entries
+// the calls in order.  UNIXERR if path cannot be read, BADTRACE if a
+// line makes no sense.
+const Status readTrace(const string & path, vector<string> & files,
+                       vector<TraceEntry> & entries);
+
+// Deal the pins and unpins of a trace out to threads streams, 0 meaning
+// one per traced thread; any number may be asked for.  They go in
+// spans: everything a traced thread does from a pin taken while it
+// holds none to the unpin that gives back its last, so that each pin
+// stays paired with its unpin, nested ones included.  Unpins of pins
+// taken before the trace started are dropped.  The disposes go to
+// disposes, in order, since a page one stream disposes of may still be
+// in use by another.  Returns the number of streams, none of which is
+// empty; fewer than threads if the trace has fewer spans.
+int splitTrace(const vector<TraceEntry> & entries, const int threads,
+               vector<vector<TraceEntry> > & streams,
+               vector<TraceEntry> & disposes);
+
+class BufMgr;
+
+// Replay streams against mgr, each on a thread of its own, then
+// disposes once they have all finished, with files standing for the
+// file numbers of the entries.  Only the order within a stream is
+// kept.  allocPage cannot be repeated as it was, since the file
+// decides which page comes next, so it is replayed as a readPage of
+// the page it returned, which the file must already have.
+//
+// latency gets the time of every readPage, seconds the time of the
+// whole replay.  Returns the first error a stream ran into; that
+// stream stops there, the others run to the end, and the disposes
+// are not replayed.
+const Status replayTrace(BufMgr* mgr, const vector<File*> & files,
+                         const vector<vector<TraceEntry> > & streams,
+                         const vector<TraceEntry> & disposes,
+                         Histogram & latency, double & seconds);
+
+#endif